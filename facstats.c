@@ -0,0 +1,38 @@
+//---------------------------------------------------------------------
+// Assignment : PA-02 Concurrent Processes & IPC
+// Date       : 11/04/2024
+// Authors    : Joshua Cassada (cassadjx@dukes.jmu.edu) and Thomas Cantrell (cantretw@dukes.jmu.edu)
+// File name  : facstats.c
+//----------------------------------------------------------------------
+#include "facstats.h"
+
+// Add to a slot. Only the factory that owns the slot may call this
+void statsUpdate( facStats *s , int parts , int iterations , long busyUs , long waitUs ) {
+    unsigned seq = s->seq;
+
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&s->parts, s->parts + parts, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->iterations, s->iterations + iterations, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->busyUs, s->busyUs + busyUs, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->waitUs, s->waitUs + waitUs, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Copy a consistent view of a slot, from any process
+void statsSnapshot( const facStats *s , facStats *out ) {
+    unsigned before, after;
+
+    do {
+        before = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        out->parts = __atomic_load_n(&s->parts, __ATOMIC_RELAXED);
+        out->iterations = __atomic_load_n(&s->iterations, __ATOMIC_RELAXED);
+        out->busyUs = __atomic_load_n(&s->busyUs, __ATOMIC_RELAXED);
+        out->waitUs = __atomic_load_n(&s->waitUs, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+    out->seq = before;
+}
@@ -0,0 +1,23 @@
+//---------------------------------------------------------------------
+// Assignment : PA-02 Concurrent Processes & IPC
+// Date       : 11/04/2024
+// Authors    : Joshua Cassada (cassadjx@dukes.jmu.edu) and Thomas Cantrell (cantretw@dukes.jmu.edu)
+// File name  : facstats.h
+//----------------------------------------------------------------------
+
+// Per-factory statistics slot in shared memory. Each factory is the only writer
+// of its own slot, which sits on its own cache line so factories never share
+// one. Readers take a seqlock snapshot: 'seq' is odd while an update is in
+// progress, and a reader retries if it saw it odd or changed. The writer never
+// waits for a reader
+typedef struct 
+{
+    unsigned  seq ;
+    int       parts ;        // #parts made
+    int       iterations ;   // #batches made
+    long      busyUs ;       // time spent making parts, uSecs
+    long      waitUs ;       // time spent waiting on sem_factory_log and report credits, uSecs
+} __attribute__(( aligned( 64 ) )) facStats ;
+
+void statsUpdate( facStats *s , int parts , int iterations , long busyUs , long waitUs ) ;
+void statsSnapshot( const facStats *s , facStats *out ) ;
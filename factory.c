@@ -7,98 +7,366 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
 #include "wrappers.h"
 #include "message.h"
 #include "shmem.h"
 
-int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <factory_id> <capacity> <duration>\n", argv[0]);
+// One logical factory. Normally a process runs exactly one, but a worker
+// process (-w) runs every factory it hosts as a state machine off a timer heap
+typedef struct {
+    int  factoryId, capacity, duration;
+    int  shard;                 //supervisor shard this factory reports to
+    int  iterations;
+    int  totalPartsMade;
+    int  partsToMake;           //claimed for the batch in progress
+    //parts and iterations made but not yet reported to the supervisor
+    int  pendingParts;
+    int  pendingIterations;
+    struct timespec wakeAt;     //when the batch in progress is done
+    long claimedAt;             //when the batch in progress was claimed, uSecs
+    long waitUs;                //time spent blocked since the stats slot was last updated
+    facStats *stats;            //this factory's slot in shared memory
+    //worker mode only: a full or final report is waiting for a credit, so the
+    //factory is parked on the timer heap and retries instead of blocking the worker
+    int  needsCredit;
+    int  finishing;             //the order is complete, only the final report is left
+    long parkedAt;              //when it started waiting for the credit, uSecs
+} factory_t;
+
+// How often a parked worker-mode factory retries for a report credit
+#define CREDIT_RETRY_MS     5
+
+shData *sharedData;
+sem_t  *sem_factory_log;
+int     msgids[MAXSHARDS];
+sem_t  *sem_credits[MAXSHARDS];
+
+// CLOCK_MONOTONIC in uSecs, cheap enough for the hot path since it never enters the kernel
+long nowUs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+// Sem_wait that charges the time spent blocked to the factory
+void timedWait(factory_t *f, sem_t *sem) {
+    long start = nowUs();
+    Sem_wait(sem);
+    f->waitUs += nowUs() - start;
+}
+
+// Send one report to the Supervisor. Capacity and duration are registered in
+// shared memory, so only what changed since the last report goes on the queue
+void sendReport(factory_t *f, msgPurpose_t purpose, int partsMade, int iterations) {
+    msgBuf msg;
+    report_t r;
+    r.facID = f->factoryId;
+    r.partsMade = partsMade;
+    r.iterations = iterations;
+    r.timestamp = reportClock(&sharedData->startTime);
+    packMsg(&msg, purpose, &r);
+
+    if (msgsnd(msgids[f->shard], &msg, MSG_INFO_SIZE, 0) == -1) {
+        perror(purpose == PRODUCTION_MSG ? "msgsnd production failed" : "msgsnd completion failed");
         exit(1);
     }
-    //Recieve command line parameters converting to integer
-    int factoryId = atoi(argv[1]);
-    int capacity = atoi(argv[2]);
-    int duration = atoi(argv[3]);
+}
 
+void factoryStart(factory_t *f, int factoryId, int capacity, int duration) {
+    memset(f, 0, sizeof(*f));
+    f->factoryId = factoryId;
+    f->capacity = capacity;
+    f->duration = duration;
+    f->shard = SHARD_OF(factoryId, sharedData->numShards);
+    f->stats = &sharedData->stats[factoryId - 1];
+    logPrintf("Factory # %2d: STARTED. My Capacity = %3d, in %4d milliSeconds\n",
+              factoryId, capacity, duration);
+}
+
+// Claim the next batch of parts. Returns 0 once the order is complete
+int factoryClaim(factory_t *f) {
+    //protected section of code under semwait and post
+    timedWait(f, sem_factory_log);
+    if (sharedData->remain <= 0) {
+        Sem_post(sem_factory_log);
+        return 0;
+    }
+    f->partsToMake = (sharedData->remain < f->capacity) ? sharedData->remain : f->capacity;
+    sharedData->remain -= f->partsToMake;
     
-    key_t shmkey = ftok("sales.c", 1);
-    int shmid = Shmget(shmkey, SHMEM_SIZE, S_IRUSR | S_IWUSR);
-    
-    shData *sharedData = Shmat(shmid, NULL, 0);
-    key_t msgkey = ftok("factory.c", 1);
-    int msgid = Msgget(msgkey, S_IRUSR | S_IWUSR);
-    sem_t *sem_factory_log = Sem_open2("/cantretw_sem_factory_log", 0);
-
-    Sem_wait(sem_factory_log);
-    printf("Factory # %2d: STARTED. My Capacity = %3d, in %4d milliSeconds\n", factoryId, capacity, duration);
-    fflush(stdout);
+    logPrintf("Factory # %2d: Going to make %3d parts in %4d milliSecs\n", 
+              f->factoryId, f->partsToMake, f->duration);
     Sem_post(sem_factory_log);
-    int iterations = 0;
-    int totalPartsMade = 0;
-
-    while (1) {
-        int partsToMake;
-        //protected section of code under semwait and post
-        Sem_wait(sem_factory_log);
-        if (sharedData->remain <= 0) {
-            Sem_post(sem_factory_log);
-            break;
+
+    clock_gettime(CLOCK_MONOTONIC, &f->wakeAt);
+    f->claimedAt = f->wakeAt.tv_sec * 1000000L + f->wakeAt.tv_nsec / 1000;
+    f->wakeAt.tv_sec += f->duration / 1000;
+    f->wakeAt.tv_nsec += (f->duration % 1000) * 1000000L;
+    if (f->wakeAt.tv_nsec >= 1000000000L) {
+        f->wakeAt.tv_sec++;
+        f->wakeAt.tv_nsec -= 1000000000L;
+    }
+    return 1;
+}
+
+// Account for the batch that just finished and report it if we have a credit.
+// A report that cannot absorb another iteration waits for its credit if
+// mayBlock, otherwise the factory is marked needsCredit for the caller to park
+void factoryFinishBatch(factory_t *f, int mayBlock) {
+    f->totalPartsMade += f->partsToMake;
+    f->iterations++;
+    f->pendingParts += f->partsToMake;
+    f->pendingIterations++;
+    long busyUs = nowUs() - f->claimedAt;
+
+    //only report if the supervisor has a credit for us, otherwise keep producing
+    //and fold this iteration into the next report instead of blocking in msgsnd.
+    //a report that could not absorb another iteration has to wait for its credit
+    int reportFull = f->pendingIterations == REPORT_MAX_ITERS
+                  || f->pendingParts + f->capacity > REPORT_MAX_PARTS;
+    int haveCredit = (Sem_trywait(sem_credits[f->shard]) == 0);
+    if (!haveCredit && reportFull) {
+        if (mayBlock) {
+            logFlush();
+            timedWait(f, sem_credits[f->shard]);
+            haveCredit = 1;
         }
-        partsToMake = (sharedData->remain < capacity) ? sharedData->remain : capacity;
-        sharedData->remain -= partsToMake;
-        
-        printf("Factory # %2d: Going to make %3d parts in %4d milliSecs\n", 
-               factoryId, partsToMake, duration);
-        fflush(stdout);
-        Sem_post(sem_factory_log);
+        else {
+            f->needsCredit = 1;
+            f->parkedAt = nowUs();
+        }
+    }
 
-        //usleep function to simulate manufactoring process
-        Usleep(duration * 1000);
-        //protected section to make sure other factories dont overlap in parts to make
-        Sem_wait(sem_factory_log);
-        sharedData->made += partsToMake;
-        Sem_post(sem_factory_log);
+    //protected section to make sure other factories dont overlap in parts to make
+    timedWait(f, sem_factory_log);
+    sharedData->made += f->partsToMake;
+    if (!haveCredit)
+        sharedData->creditStalls++;
+    Sem_post(sem_factory_log);
+
+    //publish to our own stats slot before the report, so the slot is never behind the supervisor
+    statsUpdate(f->stats, f->partsToMake, 1, busyUs, f->waitUs);
+    f->waitUs = 0;
+
+    if (haveCredit) {
+        sendReport(f, PRODUCTION_MSG, f->pendingParts, f->pendingIterations);
+        f->pendingParts = 0;
+        f->pendingIterations = 0;
+    }
+}
+
+// Worker mode: try once more for the credit a parked factory is waiting on,
+// and send its pending report if it got one. Returns 0 if still no credit
+int factoryRetryReport(factory_t *f) {
+    if (Sem_trywait(sem_credits[f->shard]) != 0)
+        return 0;
+    f->waitUs += nowUs() - f->parkedAt;
+    f->needsCredit = 0;
+    sendReport(f, PRODUCTION_MSG, f->pendingParts, f->pendingIterations);
+    f->pendingParts = 0;
+    f->pendingIterations = 0;
+    return 1;
+}
+
+void factoryTerminate(factory_t *f) {
+    //flush whatever is still unreported, this time waiting for a credit
+    if (f->pendingIterations > 0) {
+        logFlush();
+        timedWait(f, sem_credits[f->shard]);
+        sendReport(f, PRODUCTION_MSG, f->pendingParts, f->pendingIterations);
+    }
+    statsUpdate(f->stats, 0, 0, 0, f->waitUs);
+    f->waitUs = 0;
+    //completion message, the supervisor already has the totals from the production reports
+    sendReport(f, COMPLETION_MSG, 0, 0);
+
+    logPrintf(">>> Factory # %2d: Terminating after making total of %4d parts in %4d iterations\n",
+              f->factoryId, f->totalPartsMade, f->iterations);
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC time
+void sleepUntil(const struct timespec *when) {
+    int rc;
+    while ((rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, when, NULL)) != 0) {
+        if (rc != EINTR)
+            posix_error(rc, "clock_nanosleep() error");
+    }
+}
+
+//------------------
+// Timer heap of hosted factories, earliest wakeAt on top
 
-        totalPartsMade += partsToMake;
-        iterations++;
-        msgBuf msg = {0};
-        msg.mtype = 1;
-        msg.purpose = PRODUCTION_MSG;
-        msg.facID = factoryId;
-        msg.capacity = capacity;
-        msg.partsMade = partsToMake;
-        msg.duration = duration;
-
-        if (msgsnd(msgid, &msg, MSG_INFO_SIZE, 0) == -1) {
-            perror("msgsnd production failed");
-            exit(1);
+int earlier(factory_t *a, factory_t *b) {
+    if (a->wakeAt.tv_sec != b->wakeAt.tv_sec)
+        return a->wakeAt.tv_sec < b->wakeAt.tv_sec;
+    return a->wakeAt.tv_nsec < b->wakeAt.tv_nsec;
+}
+
+void heapPush(factory_t **heap, int *n, factory_t *f) {
+    int i = (*n)++;
+    while (i > 0 && earlier(f, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = f;
+}
+
+factory_t *heapPop(factory_t **heap, int *n) {
+    factory_t *top = heap[0];
+    factory_t *last = heap[--(*n)];
+    int i = 0;
+    while (2 * i + 1 < *n) {
+        int child = 2 * i + 1;
+        if (child + 1 < *n && earlier(heap[child + 1], heap[child]))
+            child++;
+        if (!earlier(heap[child], last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+// Park a factory that is waiting for a report credit: it comes back off the
+// heap in CREDIT_RETRY_MS to try again, while the others keep producing
+void park(factory_t **heap, int *n, factory_t *f) {
+    clock_gettime(CLOCK_MONOTONIC, &f->wakeAt);
+    f->wakeAt.tv_nsec += CREDIT_RETRY_MS * 1000000L;
+    if (f->wakeAt.tv_nsec >= 1000000000L) {
+        f->wakeAt.tv_sec++;
+        f->wakeAt.tv_nsec -= 1000000000L;
+    }
+    heapPush(heap, n, f);
+}
+
+// Handle a hosted factory whose timer fired: its batch finished, or it was
+// parked waiting for a credit. Never blocks on a credit, so one factory's
+// report cannot hold up the others the worker hosts
+void workerStep(factory_t **heap, int *n, factory_t *f) {
+    if (f->needsCredit) {
+        if (!factoryRetryReport(f)) {
+            park(heap, n, f);
+            return;
         }
     }
-    //completion message
-    msgBuf msg = {0};
-    msg.mtype = 1;
-    msg.purpose = COMPLETION_MSG;
-    msg.facID = factoryId;
-    msg.capacity = capacity;
-    msg.partsMade = totalPartsMade;
-    msg.duration = duration;
-
-    if (msgsnd(msgid, &msg, MSG_INFO_SIZE, 0) == -1) {
-        perror("msgsnd completion failed");
+    else if (!f->finishing) {
+        factoryFinishBatch(f, 0);
+        if (f->needsCredit) {
+            park(heap, n, f);
+            return;
+        }
+    }
+    if (!f->finishing && factoryClaim(f)) {
+        heapPush(heap, n, f);
+        return;
+    }
+    //order complete, the final report needs a credit before the completion message
+    f->finishing = 1;
+    if (f->pendingIterations > 0) {
+        f->needsCredit = 1;
+        f->parkedAt = nowUs();
+        if (!factoryRetryReport(f)) {
+            park(heap, n, f);
+            return;
+        }
+    }
+    factoryTerminate(f);
+}
+
+// Run every factory with (id - 1) % numWorkers == worker in this one process.
+// Whichever factory's batch finishes first is handled next, so all of them keep
+// the same claim and report behavior they would have as separate processes
+void runWorker(int worker) {
+    int numWorkers = sharedData->numWorkers;
+    int numFactories = sharedData->activeFactories;
+    int hosted = 0;
+    factory_t *factories = calloc(numFactories / numWorkers + 1, sizeof(factory_t));
+    factory_t **heap = calloc(numFactories / numWorkers + 1, sizeof(factory_t *));
+    if (factories == NULL || heap == NULL)
+        unix_error("worker calloc failed");
+
+    for (int id = worker + 1; id <= numFactories; id += numWorkers) {
+        factory_t *f = &factories[hosted++];
+        factoryStart(f, id, sharedData->factories[id - 1].capacity,
+                     sharedData->factories[id - 1].duration);
+    }
+    int n = 0;
+    for (int i = 0; i < hosted; i++) {
+        if (factoryClaim(&factories[i]))
+            heapPush(heap, &n, &factories[i]);
+        else
+            factoryTerminate(&factories[i]);
+    }
+
+    while (n > 0) {
+        //flush the log before every sleep, like a single factory does
+        logFlush();
+        sleepUntil(&heap[0]->wakeAt);
+        workerStep(heap, &n, heapPop(heap, &n));
+    }
+    free(heap);
+    free(factories);
+}
+
+int main(int argc, char *argv[]) {
+    int worker = -1;
+    if (argc == 3 && strcmp(argv[1], "-w") == 0) {
+        worker = atoi(argv[2]);
+    }
+    else if (argc != 4) {
+        fprintf(stderr, "Usage: %s <factory_id> <capacity> <duration>\n", argv[0]);
+        fprintf(stderr, "       %s -w <worker>\n", argv[0]);
         exit(1);
     }
+    
+    key_t shmkey = ftok("sales.c", 1);
+    int shmid = Shmget(shmkey, SHMEM_SIZE, S_IRUSR | S_IWUSR);
+    
+    sharedData = Shmat(shmid, NULL, 0);
+    //one queue and credit semaphore per supervisor shard, a factory reports to the shard that owns it
+    for (int i = 0; i < sharedData->numShards; i++) {
+        key_t msgkey = ftok("factory.c", i + 1);
+        msgids[i] = Msgget(msgkey, S_IRUSR | S_IWUSR);
+        char creditsName[50];
+        snprintf(creditsName, sizeof(creditsName), CREDITS_SEM_NAME, i);
+        sem_credits[i] = Sem_open2(creditsName, 0);
+    }
+    sem_factory_log = Sem_open2("/cantretw_sem_factory_log", 0);
 
-    Sem_wait(sem_factory_log);
-    printf(">>> Factory # %2d: Terminating after making total of %4d parts in %4d iterations\n",
-           factoryId, totalPartsMade, iterations);
-    fflush(stdout);
-    Sem_post(sem_factory_log);
+    //log lines are buffered and go out in one batch right before we sleep,
+    //so no write ever happens while sem_factory_log is held
+    logInit(fileno(stdout));
+
+    if (worker >= 0) {
+        runWorker(worker);
+        logClose(&sharedData->workers[worker].log);
+        readFootprint(&sharedData->workers[worker].mem);
+    }
+    else {
+        //Recieve command line parameters converting to integer
+        factory_t f;
+        factoryStart(&f, atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+        while (factoryClaim(&f)) {
+            //usleep function to simulate manufactoring process
+            logFlush();
+            Usleep(f.duration * 1000);
+            factoryFinishBatch(&f, 1);
+        }
+        factoryTerminate(&f);
+        logClose(&sharedData->factories[f.factoryId - 1].log);
+        readFootprint(&sharedData->factories[f.factoryId - 1].mem);
+    }
 
+    for (int i = 0; i < sharedData->numShards; i++)
+        Sem_close(sem_credits[i]);
     Sem_close(sem_factory_log);
     Shmdt(sharedData);
     return 0;
-}
\ No newline at end of file
+}
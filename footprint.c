@@ -0,0 +1,41 @@
+//---------------------------------------------------------------------
+// Assignment : PA-02 Concurrent Processes & IPC
+// Date       : 11/04/2024
+// Authors    : Joshua Cassada (cassadjx@dukes.jmu.edu) and Thomas Cantrell (cantretw@dukes.jmu.edu)
+// File name  : footprint.c
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+
+#include "footprint.h"
+
+// Read the calling process's RSS and PSS. Uses /proc/self/smaps_rollup, and falls
+// back to VmRSS in /proc/self/status (with no PSS) on kernels that lack it
+void readFootprint( footprint_t *fp ) {
+    char line[256];
+    FILE *f;
+
+    fp->rssKb = 0;
+    fp->pssKb = 0;
+
+    f = fopen("/proc/self/smaps_rollup", "r");
+    if (f != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (strncmp(line, "Rss:", 4) == 0)
+                sscanf(line + 4, "%ld", &fp->rssKb);
+            else if (strncmp(line, "Pss:", 4) == 0)
+                sscanf(line + 4, "%ld", &fp->pssKb);
+        }
+        fclose(f);
+        return;
+    }
+
+    f = fopen("/proc/self/status", "r");
+    if (f != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (strncmp(line, "VmRSS:", 6) == 0)
+                sscanf(line + 6, "%ld", &fp->rssKb);
+        }
+        fclose(f);
+    }
+}
@@ -0,0 +1,17 @@
+//---------------------------------------------------------------------
+// Assignment : PA-02 Concurrent Processes & IPC
+// Date       : 11/04/2024
+// Authors    : Joshua Cassada (cassadjx@dukes.jmu.edu) and Thomas Cantrell (cantretw@dukes.jmu.edu)
+// File name  : footprint.h
+//----------------------------------------------------------------------
+
+// Memory footprint of one process, in kB. PSS splits shared pages (libc, the
+// shared memory segment) evenly among the processes that map them, so summing
+// PSS over the fleet gives its real cost, while summing RSS over-counts
+typedef struct 
+{
+    long  rssKb ;
+    long  pssKb ;
+} footprint_t ;
+
+void readFootprint( footprint_t *fp ) ;
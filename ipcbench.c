@@ -0,0 +1,463 @@
+//---------------------------------------------------------------------
+// Assignment : PA-02 Concurrent Processes & IPC
+// Date       : 11/04/2024
+// Authors    : Joshua Cassada (cassadjx@dukes.jmu.edu) and Thomas Cantrell (cantretw@dukes.jmu.edu)
+// File name  : ipcbench.c
+//----------------------------------------------------------------------
+// Microbenchmarks for the IPC primitives sales, supervisor and factory are
+// built on, each timed through the same wrappers the programs use.
+//
+// Every benchmark runs once to warm up, then -r times (default 5), and its
+// fastest ns/op is reported, since anything else on the host only ever adds
+// time. Results go to stdout (or -o file) as CSV:
+//     benchmark,ops,ns_per_op,nproc
+// With -c <baseline.csv>, every result is also compared to the baseline. A
+// benchmark is only suspect if it got slower by more than -t percent (default
+// 25) AND by more than twice its own spread across the repeats. A suspect is
+// measured again, and the run exits 1 only if it is still that much slower,
+// or if a benchmark and a baseline row do not match up. A baseline recorded
+// on a host with a different number of CPUs is compared row by row, with a
+// note, but rows only one of the two hosts could run are not failures
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "wrappers.h"
+
+#define MAXRESULTS      32
+#define MAXMSGSIZE      4096
+#define MAXREPEATS      25
+#define RERUNS          3       //times a suspect is measured again before it counts
+#define RERUNPAUSE      2       //seconds before the first of those, doubling each time,
+                                //to get past a busy spell on the host
+
+typedef struct {
+    char    name[40];
+    long    ops;
+    double  nsPerOp;    //fastest of the repeats
+    double  spreadPct;  //(median - fastest) repeat, as a % of the fastest
+    int     skipped;    //this host has too few CPUs to run it
+    int     matched;    //found in the baseline
+    double  baseNs;     //its baseline ns/op
+    int     suspect;    //slower than the baseline, and not yet cleared by a re-run
+} result_t;
+
+result_t results[MAXRESULTS];
+int      numResults = 0;
+int      numCpus = 1;
+int      repeats = 5;
+
+long nowNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// Reap a benchmark child, failing the run if it did not exit cleanly
+void reap(pid_t pid) {
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "ipcbench: benchmark child %d failed\n", pid);
+        exit(1);
+    }
+}
+
+/*--------------------------------------------------------------------
+   Named semaphore ping-pong between two processes. One op is a full
+   round trip: Sem_post to the other side, Sem_wait for its answer
+----------------------------------------------------------------------*/
+long benchSemPingPong(long rounds, int unused) {
+    (void)unused;
+    sem_unlink("/cantretw_bench_ping");
+    sem_unlink("/cantretw_bench_pong");
+    sem_t *ping = Sem_open("/cantretw_bench_ping", O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 0);
+    sem_t *pong = Sem_open("/cantretw_bench_pong", O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 0);
+
+    pid_t pid = Fork();
+    if (pid == 0) {
+        for (long i = 0; i < rounds; i++) {
+            Sem_wait(ping);
+            Sem_post(pong);
+        }
+        exit(0);
+    }
+    long start = nowNs();
+    for (long i = 0; i < rounds; i++) {
+        Sem_post(ping);
+        Sem_wait(pong);
+    }
+    long elapsed = nowNs() - start;
+    reap(pid);
+
+    Sem_close(ping);
+    Sem_close(pong);
+    Sem_unlink("/cantretw_bench_ping");
+    Sem_unlink("/cantretw_bench_pong");
+    return elapsed;
+}
+
+/*--------------------------------------------------------------------
+   SysV message queue round trip with 'size' bytes of payload. The
+   child echoes every type 1 message back as type 2 on the same queue
+----------------------------------------------------------------------*/
+typedef struct {
+    long  mtype;
+    char  data[MAXMSGSIZE];
+} benchMsg;
+
+long benchMsgRoundTrip(long rounds, int size) {
+    int msgid = Msgget(IPC_PRIVATE, IPC_CREAT | S_IRUSR | S_IWUSR);
+    benchMsg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    pid_t pid = Fork();
+    if (pid == 0) {
+        for (long i = 0; i < rounds; i++) {
+            if (msgrcv(msgid, &msg, size, 1, 0) == -1)
+                unix_error("ipcbench msgrcv failed");
+            msg.mtype = 2;
+            if (msgsnd(msgid, &msg, size, 0) == -1)
+                unix_error("ipcbench msgsnd failed");
+        }
+        exit(0);
+    }
+    long start = nowNs();
+    for (long i = 0; i < rounds; i++) {
+        msg.mtype = 1;
+        if (msgsnd(msgid, &msg, size, 0) == -1)
+            unix_error("ipcbench msgsnd failed");
+        if (msgrcv(msgid, &msg, size, 2, 0) == -1)
+            unix_error("ipcbench msgrcv failed");
+    }
+    long elapsed = nowNs() - start;
+    reap(pid);
+
+    msgctl(msgid, IPC_RMID, NULL);
+    return elapsed;
+}
+
+/*--------------------------------------------------------------------
+   N processes incrementing one counter in SysV shared memory with
+   atomic fetch-and-add. One op is one increment, so the cost includes
+   bouncing the cache line between the contenders. All of them spin on
+   a start flag, so they really do run at the same time, and the clock
+   stops at the last one's own finish time rather than when it is reaped.
+   'incs' is the total over all N. Skipped when the host has fewer
+   than N CPUs, since the processes would then just take turns
+----------------------------------------------------------------------*/
+typedef struct {
+    long  counter  __attribute__((aligned(64)));
+    int   ready    __attribute__((aligned(64)));   //#children spinning on go
+    int   go ;
+    long  endNs[64] ;                               //when each child finished
+} contention_t;
+
+long benchShmAtomic(long incs, int nprocs) {
+    long incsPerProc = incs / nprocs;
+    pid_t pids[64];
+
+    int shmid = Shmget(IPC_PRIVATE, sizeof(contention_t), IPC_CREAT | S_IRUSR | S_IWUSR);
+    contention_t *c = Shmat(shmid, NULL, 0);
+    memset(c, 0, sizeof(*c));
+
+    for (int p = 0; p < nprocs; p++) {
+        pids[p] = Fork();
+        if (pids[p] == 0) {
+            __atomic_fetch_add(&c->ready, 1, __ATOMIC_SEQ_CST);
+            while (!__atomic_load_n(&c->go, __ATOMIC_ACQUIRE))
+                sched_yield();
+            for (long i = 0; i < incsPerProc; i++)
+                __atomic_fetch_add(&c->counter, 1, __ATOMIC_SEQ_CST);
+            c->endNs[p] = nowNs();
+            exit(0);
+        }
+    }
+    while (__atomic_load_n(&c->ready, __ATOMIC_ACQUIRE) < nprocs)
+        sched_yield();
+    long start = nowNs();
+    __atomic_store_n(&c->go, 1, __ATOMIC_RELEASE);
+    //block instead of spinning, so the parent does not compete for the CPUs
+    long last = start;
+    for (int p = 0; p < nprocs; p++)
+        reap(pids[p]);
+    for (int p = 0; p < nprocs; p++)
+        if (c->endNs[p] > last)
+            last = c->endNs[p];
+    long elapsed = last - start;
+
+    if (c->counter != incsPerProc * nprocs) {
+        fprintf(stderr, "ipcbench: shm counter is %ld, expected %ld\n", c->counter, incsPerProc * nprocs);
+        exit(1);
+    }
+
+    Shmdt(c);
+    shmctl(shmid, IPC_RMID, NULL);
+    return elapsed;
+}
+
+/*--------------------------------------------------------------------
+   Start-up cost of a factory-style process (fork, then exec a program
+   that exits at once, then wait) vs. a thread (create, then join)
+----------------------------------------------------------------------*/
+long benchForkExec(long rounds, int unused) {
+    (void)unused;
+    long start = nowNs();
+    for (long i = 0; i < rounds; i++) {
+        pid_t pid = Fork();
+        if (pid == 0) {
+            execl("/proc/self/exe", "ipcbench", "--noop", NULL);
+            perror("execl ipcbench");
+            exit(1);
+        }
+        reap(pid);
+    }
+    return nowNs() - start;
+}
+
+void *noopThread(void *arg) {
+    return arg;
+}
+
+long benchThreadStart(long rounds, int unused) {
+    pthread_t tid;
+    (void)unused;
+    long start = nowNs();
+    for (long i = 0; i < rounds; i++) {
+        Pthread_create(&tid, NULL, noopThread, NULL);
+        Pthread_join(tid, NULL);
+    }
+    return nowNs() - start;
+}
+
+/*--------------------------------------------------------------------
+   Every benchmark, by name. 'ops' is at scale 1, and 'arg' goes to
+   the benchmark as its second parameter. 'minCpus' is how many CPUs
+   it needs to mean anything
+----------------------------------------------------------------------*/
+typedef struct {
+    const char *name;
+    long      (*run)(long ops, int arg);
+    long        ops;
+    int         arg;
+    int         minCpus;
+} bench_t;
+
+bench_t benches[] = {
+    {"sem_pingpong",        benchSemPingPong,   100000,   0,    1},
+    {"msgq_roundtrip_8",    benchMsgRoundTrip,  50000,    8,    1},
+    {"msgq_roundtrip_64",   benchMsgRoundTrip,  50000,    64,   1},
+    {"msgq_roundtrip_512",  benchMsgRoundTrip,  50000,    512,  1},
+    {"msgq_roundtrip_4096", benchMsgRoundTrip,  50000,    4096, 1},
+    {"shm_atomic_inc_1way", benchShmAtomic,     10000000, 1,    1},
+    {"shm_atomic_inc_2way", benchShmAtomic,     10000000, 2,    2},
+    {"shm_atomic_inc_4way", benchShmAtomic,     10000000, 4,    4},
+    {"shm_atomic_inc_8way", benchShmAtomic,     10000000, 8,    8},
+    {"fork_exec_wait",      benchForkExec,      1000,     0,    1},
+    {"thread_create_join",  benchThreadStart,   20000,    0,    1},
+};
+#define NUMBENCHES  (int)(sizeof(benches) / sizeof(benches[0]))
+
+int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Run one benchmark once to warm up, then 'repeats' more times, and keep
+// the fastest of those and how far the median is from it into its result
+void measure(bench_t *b, result_t *r, int scale) {
+    double samples[MAXREPEATS];
+
+    r->ops = b->ops * scale;
+    b->run(r->ops, b->arg);
+    for (int i = 0; i < repeats; i++)
+        samples[i] = (double)b->run(r->ops, b->arg) / r->ops;
+    qsort(samples, repeats, sizeof(double), compareDoubles);
+    r->nsPerOp = samples[0];
+    r->spreadPct = (samples[(repeats - 1) / 2] - samples[0]) * 100.0 / r->nsPerOp;
+}
+
+// How much slower than the baseline counts, for a result this noisy
+double regressionLimit(result_t *r, double tolerancePct) {
+    return (2 * r->spreadPct > tolerancePct) ? 2 * r->spreadPct : tolerancePct;
+}
+
+// Compare a result to its baseline, print the comparison, and return
+// 1 if it is slower by more than the limit
+int compare(result_t *r, double tolerancePct, const char *okVerdict, const char *slowVerdict) {
+    double changePct = (r->nsPerOp - r->baseNs) * 100.0 / r->baseNs;
+    int slower = changePct > regressionLimit(r, tolerancePct);
+    fprintf(stderr, "%-24s %12.1f ns  baseline %12.1f ns  %+7.1f%%  spread %5.1f%%  %s\n", r->name,
+            r->nsPerOp, r->baseNs, changePct, r->spreadPct, slower ? slowVerdict : okVerdict);
+    return slower;
+}
+
+/*--------------------------------------------------------------------
+   Compare every result to the baseline. A suspect is measured again,
+   after the others and up to RERUNS times, and is a regression only
+   if it never gets back within the limit. Returns the #failures: each
+   regression, and each baseline row with no result and result with
+   no baseline row. When the baseline came from a host with a
+   different #CPUs, rows only one of the hosts could run are noted,
+   but are not failures
+----------------------------------------------------------------------*/
+int checkBaseline(const char *path, double tolerancePct, int scale) {
+    FILE *f = fopen(path, "r");
+    char line[256], names[MAXRESULTS][40];
+    long ops;
+    double baseNsOf[MAXRESULTS];
+    int cpusOf[MAXRESULTS];
+    int numRows = 0, otherHost = 0;
+    int failures = 0;
+
+    if (f == NULL) {
+        perror("ipcbench: cannot open baseline");
+        exit(1);
+    }
+    //read it all first: re-measuring forks, and a child's exit would
+    //rewind the file offset it shares with us
+    while (numRows < MAXRESULTS && fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "%39[^,],%ld,%lf,%d", names[numRows], &ops, &baseNsOf[numRows],
+                   &cpusOf[numRows]) == 4)
+            numRows++;  //else the header
+    fclose(f);
+
+    for (int row = 0; row < numRows; row++) {
+        const char *name = names[row];
+        double baseNs = baseNsOf[row];
+        int baseCpus = cpusOf[row];
+        if (baseCpus != numCpus && !otherHost) {
+            fprintf(stderr, "ipcbench: baseline was recorded with %d CPU(s), this host has %d,"
+                    " comparing the rows both could run\n", baseCpus, numCpus);
+            otherHost = 1;
+        }
+        int i;
+        for (i = 0; i < numResults; i++)
+            if (strcmp(results[i].name, name) == 0)
+                break;
+        if (i == numResults) {
+            fprintf(stderr, "%-24s in the baseline but not measured  %s\n", name,
+                    otherHost ? "other host only" : "MISSING");
+            failures += !otherHost;
+            continue;
+        }
+        result_t *r = &results[i];
+        r->matched = 1;
+        if (r->skipped) {
+            fprintf(stderr, "%-24s in the baseline but needs more CPUs than this host has  %s\n",
+                    name, otherHost ? "other host only" : "MISSING");
+            failures += !otherHost;
+            continue;
+        }
+        r->baseNs = baseNs;
+        r->suspect = compare(r, tolerancePct, "ok", "suspect");
+    }
+
+    for (int rerun = 1; rerun <= RERUNS; rerun++) {
+        int suspects = 0;
+        for (int i = 0; i < numResults; i++)
+            suspects += results[i].suspect;
+        if (suspects == 0)
+            break;
+        sleep(RERUNPAUSE << (rerun - 1));
+        for (int i = 0; i < numResults; i++) {
+            if (!results[i].suspect)
+                continue;
+            measure(&benches[i], &results[i], scale);
+            results[i].suspect = compare(&results[i], tolerancePct, "ok on re-run",
+                                         rerun < RERUNS ? "still slower on re-run" : "REGRESSION");
+            failures += results[i].suspect && rerun == RERUNS;
+        }
+    }
+
+    for (int i = 0; i < numResults; i++) {
+        if (!results[i].matched && !results[i].skipped) {
+            fprintf(stderr, "%-24s measured but not in the baseline  %s\n", results[i].name,
+                    otherHost ? "other host only" : "MISSING");
+            failures += !otherHost;
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    const char *outPath = NULL, *baselinePath = NULL;
+    double tolerancePct = 25.0;
+    int scale = 1;
+    int opt;
+
+    //the program fork_exec_wait execs
+    if (argc == 2 && strcmp(argv[1], "--noop") == 0)
+        return 0;
+
+    while ((opt = getopt(argc, argv, "o:c:t:s:r:")) != -1) {
+        switch (opt) {
+            case 'o':
+                outPath = optarg;
+                break;
+            case 'c':
+                baselinePath = optarg;
+                break;
+            case 't':
+                tolerancePct = atof(optarg);
+                break;
+            case 's':
+                scale = atoi(optarg);
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-o results.csv] [-c baseline.csv] [-t tolerance%%] [-s scale]"
+                        " [-r repeats]\n",
+                        argv[0]);
+                exit(1);
+        }
+    }
+    if (scale < 1)
+        scale = 1;
+    if (repeats < 1)
+        repeats = 1;
+    if (repeats > MAXREPEATS)
+        repeats = MAXREPEATS;
+    numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numCpus < 1)
+        numCpus = 1;
+
+    //results[i] is always benches[i]'s, so a suspect can be measured again
+    for (int i = 0; i < NUMBENCHES; i++) {
+        result_t *r = &results[numResults++];
+        snprintf(r->name, sizeof(r->name), "%s", benches[i].name);
+        if (benches[i].minCpus > numCpus) {
+            fprintf(stderr, "ipcbench: skipping %s, this host has only %d CPU(s)\n", r->name, numCpus);
+            r->skipped = 1;
+            continue;
+        }
+        measure(&benches[i], r, scale);
+    }
+
+    //before writing the results, since a suspect's re-run replaces its result
+    int failures = 0;
+    if (baselinePath != NULL)
+        failures = checkBaseline(baselinePath, tolerancePct, scale);
+
+    FILE *out = stdout;
+    if (outPath != NULL && (out = fopen(outPath, "w")) == NULL) {
+        perror("ipcbench: cannot open output");
+        exit(1);
+    }
+    fprintf(out, "benchmark,ops,ns_per_op,nproc\n");
+    for (int i = 0; i < numResults; i++)
+        if (!results[i].skipped)
+            fprintf(out, "%s,%ld,%.1f,%d\n", results[i].name, results[i].ops, results[i].nsPerOp, numCpus);
+    if (out != stdout)
+        fclose(out);
+
+    return failures > 0;
+}
@@ -0,0 +1,345 @@
+//---------------------------------------------------------------------
+// Assignment : PA-02 Concurrent Processes & IPC
+// Date       : 11/04/2024
+// Authors    : Joshua Cassada (cassadjx@dukes.jmu.edu) and Thomas Cantrell (cantretw@dukes.jmu.edu)
+// File name  : logwriter.c
+//----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "logwriter.h"
+
+// Two log buffers: lines go into logBufs[cur] while the other one may still
+// be in flight on the ring
+static int         logFd = -1 ;
+static char        logBufs[2][LOG_BUF_SIZE] __attribute__((aligned(4096))) ;
+static int         cur = 0 ;
+static size_t      logLen = 0 ;
+static long        flushes = 0 ;
+static logStats_t  logStats ;
+
+// The io_uring, mapped by hand since liburing is not a dependency
+static int                  ringFd = -1 ;
+static int                  ringDisabled = 0 ;
+static int                  bufRegistered = 0 ;
+static void                *sqMap = MAP_FAILED , *cqMap = MAP_FAILED ;
+static size_t               sqMapSize , cqMapSize , sqesMapSize ;
+static unsigned            *sqHead , *sqTail , *sqMask , *sqArray ;
+static unsigned            *cqHead , *cqTail , *cqMask ;
+static struct io_uring_sqe *sqes = MAP_FAILED ;
+static struct io_uring_cqe *cqes ;
+
+// The write in flight on the ring, if any
+static int                  inflightBuf = -1 ;
+static size_t               inflightLen ;
+
+/*--------------------------------------------------------------------
+   Unmap and close the ring, counting every syscall it takes
+----------------------------------------------------------------------*/
+static void uringTeardown( void )
+{
+    if ( sqMap != MAP_FAILED )
+    {
+        logStats.setupCalls++ ;
+        munmap( sqMap , sqMapSize ) ;
+        sqMap = MAP_FAILED ;
+    }
+    if ( cqMap != MAP_FAILED )
+    {
+        logStats.setupCalls++ ;
+        munmap( cqMap , cqMapSize ) ;
+        cqMap = MAP_FAILED ;
+    }
+    if ( sqes != MAP_FAILED )
+    {
+        logStats.setupCalls++ ;
+        munmap( sqes , sqesMapSize ) ;
+        sqes = MAP_FAILED ;
+    }
+    if ( ringFd >= 0 )
+    {
+        logStats.setupCalls++ ;
+        close( ringFd ) ;
+        ringFd = -1 ;
+    }
+}
+
+/*--------------------------------------------------------------------
+   Set up a two-entry io_uring and register both log buffers with it.
+   On any failure the ring is torn down and writev() is used for good
+----------------------------------------------------------------------*/
+static void uringSetup( void )
+{
+    struct io_uring_params p ;
+
+    memset( &p , 0 , sizeof(p) ) ;
+    logStats.setupCalls++ ;
+    ringFd = syscall( __NR_io_uring_setup , 2 , &p ) ;
+    if ( ringFd < 0 )
+        goto fail ;
+
+    // Writes must go to the current file position, i.e. offset -1
+    if ( ! ( p.features & IORING_FEAT_RW_CUR_POS ) )
+        goto fail ;
+
+    sqMapSize   = p.sq_off.array + p.sq_entries * sizeof(unsigned) ;
+    cqMapSize   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) ;
+    sqesMapSize = p.sq_entries * sizeof(struct io_uring_sqe) ;
+
+    logStats.setupCalls++ ;
+    sqMap = mmap( NULL , sqMapSize , PROT_READ | PROT_WRITE
+                , MAP_SHARED | MAP_POPULATE , ringFd , IORING_OFF_SQ_RING ) ;
+    if ( sqMap == MAP_FAILED )
+        goto fail ;
+    logStats.setupCalls++ ;
+    cqMap = mmap( NULL , cqMapSize , PROT_READ | PROT_WRITE
+                , MAP_SHARED | MAP_POPULATE , ringFd , IORING_OFF_CQ_RING ) ;
+    if ( cqMap == MAP_FAILED )
+        goto fail ;
+    logStats.setupCalls++ ;
+    sqes  = mmap( NULL , sqesMapSize , PROT_READ | PROT_WRITE
+                , MAP_SHARED | MAP_POPULATE , ringFd , IORING_OFF_SQES ) ;
+    if ( sqes == MAP_FAILED )
+        goto fail ;
+
+    sqHead  = (unsigned *) ( (char *) sqMap + p.sq_off.head ) ;
+    sqTail  = (unsigned *) ( (char *) sqMap + p.sq_off.tail ) ;
+    sqMask  = (unsigned *) ( (char *) sqMap + p.sq_off.ring_mask ) ;
+    sqArray = (unsigned *) ( (char *) sqMap + p.sq_off.array ) ;
+    cqHead  = (unsigned *) ( (char *) cqMap + p.cq_off.head ) ;
+    cqTail  = (unsigned *) ( (char *) cqMap + p.cq_off.tail ) ;
+    cqMask  = (unsigned *) ( (char *) cqMap + p.cq_off.ring_mask ) ;
+    cqes    = (struct io_uring_cqe *) ( (char *) cqMap + p.cq_off.cqes ) ;
+
+    // Registered buffers save pinning the pages on every write. Plain
+    // IORING_OP_WRITE still works if they cannot be registered (RLIMIT_MEMLOCK)
+    struct iovec iov[2] = { { logBufs[0] , LOG_BUF_SIZE } , { logBufs[1] , LOG_BUF_SIZE } } ;
+    logStats.setupCalls++ ;
+    bufRegistered = syscall( __NR_io_uring_register , ringFd
+                           , IORING_REGISTER_BUFFERS , iov , 2 ) == 0 ;
+    logStats.usingUring = 1 ;
+    return ;
+
+fail:
+    uringTeardown() ;
+    ringDisabled = 1 ;
+}
+
+/*--------------------------------------------------------------------
+   The ring failed mid-run: drop it and finish on writev(), which is
+   then what the statistics report
+----------------------------------------------------------------------*/
+static void uringAbandon( void )
+{
+    uringTeardown() ;
+    ringDisabled = 1 ;
+    logStats.usingUring = 0 ;
+}
+
+/*--------------------------------------------------------------------
+   Write len bytes with plain writev(), retrying short writes
+----------------------------------------------------------------------*/
+static void plainWrite( char *buf , size_t len )
+{
+    size_t  done = 0 ;
+    ssize_t n ;
+
+    while ( done < len )
+    {
+        struct iovec iov = { buf + done , len - done } ;
+        logStats.writeCalls++ ;
+        n = writev( logFd , &iov , 1 ) ;
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+                continue ;
+            perror( "log writev failed" ) ;
+            return ;
+        }
+        done += n ;
+    }
+}
+
+/*--------------------------------------------------------------------
+   Wait for the write in flight, if any. Usually it finished while the
+   caller slept, and the completion is read off the ring with no syscall.
+   A short write is finished with writev(), a failed one is redone with
+   writev() and the ring is dropped
+----------------------------------------------------------------------*/
+static void uringReap( void )
+{
+    unsigned  head ;
+    int       res ;
+
+    if ( inflightBuf < 0 )
+        return ;
+
+    head = *cqHead ;
+    while ( head == __atomic_load_n( cqTail , __ATOMIC_ACQUIRE ) )
+    {
+        logStats.writeCalls++ ;
+        if ( syscall( __NR_io_uring_enter , ringFd , 0 , 1 , IORING_ENTER_GETEVENTS , NULL , 0 ) < 0
+             && errno != EINTR )
+            break ;
+    }
+    if ( head == __atomic_load_n( cqTail , __ATOMIC_ACQUIRE ) )
+        res = -EIO ;
+    else
+    {
+        res = cqes[head & *cqMask].res ;
+        __atomic_store_n( cqHead , head + 1 , __ATOMIC_RELEASE ) ;
+    }
+
+    if ( res < 0 )
+    {
+        uringAbandon() ;
+        plainWrite( logBufs[inflightBuf] , inflightLen ) ;
+    }
+    else if ( (size_t) res < inflightLen )
+        plainWrite( logBufs[inflightBuf] + res , inflightLen - res ) ;
+    inflightBuf = -1 ;
+}
+
+/*--------------------------------------------------------------------
+   Submit logBufs[buf] without waiting for it to be written
+----------------------------------------------------------------------*/
+static void uringSubmit( int buf , size_t len )
+{
+    unsigned  tail = *sqTail , idx = tail & *sqMask ;
+    struct io_uring_sqe *sqe = &sqes[idx] ;
+
+    memset( sqe , 0 , sizeof(*sqe) ) ;
+    sqe->opcode = bufRegistered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE ;
+    sqe->fd     = logFd ;
+    sqe->addr   = (unsigned long) logBufs[buf] ;
+    sqe->len    = len ;
+    sqe->off    = (__u64) -1 ;
+    sqe->buf_index = buf ;
+    sqArray[idx] = idx ;
+    __atomic_store_n( sqTail , tail + 1 , __ATOMIC_RELEASE ) ;
+
+    while ( 1 )
+    {
+        logStats.writeCalls++ ;
+        if ( syscall( __NR_io_uring_enter , ringFd , 1 , 0 , 0 , NULL , 0 ) >= 0 )
+            break ;
+        // Interrupted after the kernel took the entry counts as submitted
+        if ( errno == EINTR && __atomic_load_n( sqHead , __ATOMIC_ACQUIRE ) == tail + 1 )
+            break ;
+        if ( errno != EINTR )
+        {
+            uringAbandon() ;
+            plainWrite( logBufs[buf] , len ) ;
+            return ;
+        }
+    }
+    inflightBuf = buf ;
+    inflightLen = len ;
+}
+
+/*--------------------------------------------------------------------
+   Start logging to fd. The ring is only set up once the process has
+   flushed often enough to pay for it
+----------------------------------------------------------------------*/
+void logInit( int fd )
+{
+    logFd  = fd ;
+    logLen = 0 ;
+    flushes = 0 ;
+    memset( &logStats , 0 , sizeof(logStats) ) ;
+    ringDisabled = ( getenv( "LOG_NO_URING" ) != NULL ) ;
+}
+
+/*--------------------------------------------------------------------
+   Append one formatted line to the current buffer. No syscall unless
+   the buffer is full
+----------------------------------------------------------------------*/
+void logPrintf( const char *fmt , ... )
+{
+    va_list  ap ;
+    int      n ;
+
+    va_start( ap , fmt ) ;
+    n = vsnprintf( logBufs[cur] + logLen , LOG_BUF_SIZE - logLen , fmt , ap ) ;
+    va_end( ap ) ;
+
+    if ( n >= 0 && logLen + n >= LOG_BUF_SIZE && logLen > 0 )
+    {
+        logFlush() ;
+        va_start( ap , fmt ) ;
+        n = vsnprintf( logBufs[cur] , LOG_BUF_SIZE , fmt , ap ) ;
+        va_end( ap ) ;
+    }
+    if ( n < 0 )
+        return ;
+    logLen += ( (size_t) n < LOG_BUF_SIZE - logLen ) ? (size_t) n : LOG_BUF_SIZE - 1 - logLen ;
+    logStats.lines++ ;
+}
+
+/*--------------------------------------------------------------------
+   Hand everything buffered so far to the kernel
+----------------------------------------------------------------------*/
+void logFlush( void )
+{
+    struct timespec  start , end ;
+
+    if ( logLen == 0 )
+        return ;
+
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID , &start ) ;
+    if ( ++flushes > LOG_URING_MIN_FLUSHES && ringFd < 0 && ! ringDisabled )
+        uringSetup() ;
+
+    if ( ringFd >= 0 )
+    {
+        // Only one write in flight at a time, so batches land in order
+        uringReap() ;
+        if ( ringFd >= 0 )
+        {
+            uringSubmit( cur , logLen ) ;
+            cur ^= 1 ;
+        }
+        else
+            plainWrite( logBufs[cur] , logLen ) ;
+    }
+    else
+        plainWrite( logBufs[cur] , logLen ) ;
+    logLen = 0 ;
+
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID , &end ) ;
+    logStats.cpuNs += ( end.tv_sec - start.tv_sec ) * 1000000000L
+                    + ( end.tv_nsec - start.tv_nsec ) ;
+}
+
+/*--------------------------------------------------------------------
+   Flush, wait for the last write, tear down the ring, and hand back
+   the statistics
+----------------------------------------------------------------------*/
+void logClose( logStats_t *stats )
+{
+    struct timespec  start , end ;
+
+    logFlush() ;
+
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID , &start ) ;
+    if ( ringFd >= 0 )
+    {
+        uringReap() ;
+        uringTeardown() ;
+    }
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID , &end ) ;
+    logStats.cpuNs += ( end.tv_sec - start.tv_sec ) * 1000000000L
+                    + ( end.tv_nsec - start.tv_nsec ) ;
+
+    if ( stats != NULL )
+        *stats = logStats ;
+}
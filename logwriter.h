@@ -0,0 +1,34 @@
+//---------------------------------------------------------------------
+// Assignment : PA-02 Concurrent Processes & IPC
+// Date       : 11/04/2024
+// Authors    : Joshua Cassada (cassadjx@dukes.jmu.edu) and Thomas Cantrell (cantretw@dukes.jmu.edu)
+// File name  : logwriter.h
+//----------------------------------------------------------------------
+
+// Batched log writer. Lines are formatted into one of two buffers registered
+// with an io_uring. A flush submits the buffer without waiting for the write,
+// and the next flush reaps it, so the caller sleeps while the write completes.
+// Callers flush before they block, so a line is never held back while idle.
+//
+// Setting up the ring costs 5 syscalls and tearing it down 4, which a process
+// that only logs a handful of lines never earns back. So every process starts
+// on writev() and only switches to io_uring after LOG_URING_MIN_FLUSHES flushes.
+// It stays on writev() where io_uring is unavailable, or when LOG_NO_URING is
+// set in the environment
+
+#define LOG_BUF_SIZE            65536
+#define LOG_URING_MIN_FLUSHES   64
+
+typedef struct 
+{
+    long  lines ;       // #lines logged
+    long  writeCalls ;  // #syscalls spent writing them out
+    long  setupCalls ;  // #syscalls spent setting up and tearing down the io_uring
+    long  cpuNs ;       // CPU time spent flushing, including ring setup and teardown, nSecs
+    int   usingUring ;  // 1 if the process was still writing through io_uring at the end
+} logStats_t ;
+
+void  logInit( int fd ) ;
+void  logPrintf( const char *fmt , ... ) ;
+void  logFlush( void ) ;
+void  logClose( logStats_t *stats ) ;
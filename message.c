@@ -12,8 +12,48 @@
 ----------------------------------------------------------------------*/
 void printMsg( msgBuf *m )
 {
-    printf( "{type=%ld, (Purpose=%d, FacID %3d, Capacity %3d, Parts %3d, duration %4d) }\n"
-       , m->mtype    , m->purpose   , m->facID 
-       , m->capacity , m->partsMade , m->duration  ) ;
+    report_t r ;
+
+    unpackMsg( m , &r ) ;
+    printf( "{type=%ld, (FacID %3d, Parts %3d, Iters %3d, time %8d) }\n"
+       , m->mtype   , r.facID , r.partsMade 
+       , r.iterations , r.timestamp  ) ;
+}
+
+/*--------------------------------------------------------------------
+   Pack a report into a message buffer. Fields must fit their widths
+----------------------------------------------------------------------*/
+void packMsg( msgBuf *m , msgPurpose_t purpose , const report_t *r )
+{
+    m->mtype  = purpose ;
+    m->report = ( (uint64_t) ( r->facID      & REPORT_MAX_FACID ) << 50 )
+              | ( (uint64_t) ( r->iterations & REPORT_MAX_ITERS ) << 40 )
+              | ( (uint64_t) ( r->partsMade  & REPORT_MAX_PARTS ) << 24 )
+              | ( (uint64_t) ( r->timestamp  & REPORT_TIME_MASK ) ) ;
+}
+
+/*--------------------------------------------------------------------
+   Unpack a message buffer into a report
+----------------------------------------------------------------------*/
+void unpackMsg( const msgBuf *m , report_t *r )
+{
+    r->facID      = ( m->report >> 50 ) & REPORT_MAX_FACID ;
+    r->iterations = ( m->report >> 40 ) & REPORT_MAX_ITERS ;
+    r->partsMade  = ( m->report >> 24 ) & REPORT_MAX_PARTS ;
+    r->timestamp  =   m->report         & REPORT_TIME_MASK ;
 }
 
+/*--------------------------------------------------------------------
+   Report timestamp: mSecs elapsed on CLOCK_MONOTONIC since 'start',
+   wrapped to the width of the timestamp field
+----------------------------------------------------------------------*/
+int reportClock( const struct timespec *start )
+{
+    struct timespec now ;
+    long   ms ;
+
+    clock_gettime( CLOCK_MONOTONIC , &now ) ;
+    ms = ( now.tv_sec  - start->tv_sec  ) * 1000
+       + ( now.tv_nsec - start->tv_nsec ) / 1000000 ;
+    return ms & REPORT_TIME_MASK ;
+}
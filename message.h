@@ -4,25 +4,41 @@
 // Author     : Mohamed Aboutabl
 //----------------------------------------------------------------------
 #include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
 
 typedef enum 
 {
     PRODUCTION_MSG = 1 , COMPLETION_MSG 
 } msgPurpose_t;
 
-typedef struct {
-    long mtype ;               /* not used here */
-
-    msgPurpose_t  purpose ;  /* Purpose of this message to Supervisor */
-
-    int  facID    ,          /* sender's Factory ID */
-         capacity ,          /* #of parts made in most recent iteration */
-         partsMade ,         /* #of parts made in most recent iteration */
-         duration ;          /* how long it took to make them */
+// A factory's capacity and duration never change, so they are registered once
+// in shared memory and a report only carries what happened since the last one,
+// packed into 8 bytes:
+//      bits 63..50  facID       ( 14 bits )
+//      bits 49..40  iterations  ( 10 bits )
+//      bits 39..24  partsMade   ( 16 bits )
+//      bits 23..0   timestamp   ( 24 bits, mSecs since the order started, wraps )
+#define REPORT_MAX_FACID    ( ( 1 << 14 ) - 1 )
+#define REPORT_MAX_ITERS    ( ( 1 << 10 ) - 1 )
+#define REPORT_MAX_PARTS    ( ( 1 << 16 ) - 1 )
+#define REPORT_TIME_MASK    ( ( 1 << 24 ) - 1 )
 
+typedef struct {
+    long      mtype ;        /* Purpose of this message to Supervisor */
+    uint64_t  report ;       /* packed report, see above */
 } msgBuf ;
 
+typedef struct {
+    int  facID      ,        /* sender's Factory ID */
+         partsMade  ,        /* #of parts made since the last report */
+         iterations ,        /* #of iterations folded into this report */
+         timestamp  ;        /* when it was sent, mSecs since the order started */
+} report_t ;
+
 #define MSG_INFO_SIZE ( sizeof(msgBuf) - sizeof(long) )
 
 void printMsg( msgBuf *m ) ;
-
+void packMsg( msgBuf *m , msgPurpose_t purpose , const report_t *r ) ;
+void unpackMsg( const msgBuf *m , report_t *r ) ;
+int  reportClock( const struct timespec *start ) ;
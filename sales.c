@@ -20,12 +20,16 @@
 #include <sys/stat.h>
 
 // This is our global variables initializing what we will need.
-int msgid = -1;
+int msgids[MAXSHARDS];
+int numShards = 1;
+int numWorkers = 0;
 int shmid = -1;
 sem_t *sem_rendezvous = NULL;
 sem_t *sem_factory_log = NULL;
 sem_t *printReportSem = NULL;
-pid_t childPids[MAXFACTORIES + 1];
+sem_t *shardsDoneSem = NULL;
+sem_t *sem_credits[MAXSHARDS];
+pid_t childPids[MAXFACTORIES + MAXSHARDS];
 shData *sharedData = NULL;
 int numChildren = 0;
 
@@ -49,14 +53,28 @@ void cleanup() {
         Sem_close(printReportSem);
         Sem_unlink("/cantretw_print_report_sem");
     }
+    if (shardsDoneSem) {
+        Sem_close(shardsDoneSem);
+        Sem_unlink("/cantretw_shards_done_sem");
+    }
+    for (int i = 0; i < numShards; i++) {
+        if (sem_credits[i]) {
+            char creditsName[50];
+            snprintf(creditsName, sizeof(creditsName), CREDITS_SEM_NAME, i);
+            Sem_close(sem_credits[i]);
+            Sem_unlink(creditsName);
+        }
+    }
     if (sharedData) {
         Shmdt(sharedData);
     }
     if (shmid >= 0) {
         shmctl(shmid, IPC_RMID, NULL);
     }
-    if (msgid >= 0) {
-        msgctl(msgid, IPC_RMID, NULL);
+    for (int i = 0; i < numShards; i++) {
+        if (msgids[i] >= 0) {
+            msgctl(msgids[i], IPC_RMID, NULL);
+        }
     }
 }
 
@@ -78,15 +96,97 @@ void goodbye(int sig) {
     exit(0);
 }
 
+// Print the RSS and PSS every process reported just before it exited, so hosts can
+// be sized for large fleets from the per-factory average
+void printFootprints(int numfactories) {
+    footprint_t mine, total = {0, 0}, factoryTotal = {0, 0};
+
+    readFootprint(&mine);
+    printf("SALES: Memory footprint (kB)        RSS        PSS\n");
+    printf("SALES:   sales                %10ld %10ld\n", mine.rssKb, mine.pssKb);
+    total.rssKb += mine.rssKb;
+    total.pssKb += mine.pssKb;
+    for (int i = 0; i < numShards; i++) {
+        footprint_t *fp = &sharedData->supervisorMem[i];
+        printf("SALES:   supervisor shard %2d  %10ld %10ld\n", i, fp->rssKb, fp->pssKb);
+        total.rssKb += fp->rssKb;
+        total.pssKb += fp->pssKb;
+    }
+    //with workers, the factory processes are the workers
+    int numProcs = numWorkers ? numWorkers : numfactories;
+    for (int i = 0; i < numProcs; i++) {
+        footprint_t *fp = numWorkers ? &sharedData->workers[i].mem : &sharedData->factories[i].mem;
+        printf("SALES:   %s # %5d      %10ld %10ld\n", numWorkers ? "worker " : "factory",
+               numWorkers ? i : i + 1, fp->rssKb, fp->pssKb);
+        factoryTotal.rssKb += fp->rssKb;
+        factoryTotal.pssKb += fp->pssKb;
+    }
+    total.rssKb += factoryTotal.rssKb;
+    total.pssKb += factoryTotal.pssKb;
+    printf("SALES:   fleet total          %10ld %10ld\n", total.rssKb, total.pssKb);
+    printf("SALES:   average per factory  %10.1f %10.1f\n",
+           (double)factoryTotal.rssKb / numfactories, (double)factoryTotal.pssKb / numfactories);
+}
+
+// Print what logging cost the Supervisor shards and the factories, summed over each group
+void printLogStats(int numfactories) {
+    logStats_t sup = {0}, fac = {0};
+
+    for (int i = 0; i < numShards; i++) {
+        logStats_t *ls = &sharedData->supervisorLog[i];
+        sup.lines += ls->lines;
+        sup.writeCalls += ls->writeCalls;
+        sup.setupCalls += ls->setupCalls;
+        sup.cpuNs += ls->cpuNs;
+        sup.usingUring += ls->usingUring;
+    }
+    int numProcs = numWorkers ? numWorkers : numfactories;
+    for (int i = 0; i < numProcs; i++) {
+        logStats_t *ls = numWorkers ? &sharedData->workers[i].log : &sharedData->factories[i].log;
+        fac.lines += ls->lines;
+        fac.writeCalls += ls->writeCalls;
+        fac.setupCalls += ls->setupCalls;
+        fac.cpuNs += ls->cpuNs;
+        fac.usingUring += ls->usingUring;
+    }
+    printf("SALES: Logging             lines  writes  writes/line  setup calls  flush CPU uSecs  io_uring\n");
+    printf("SALES:   supervisor   %10ld %7ld %12.3f %12ld %16ld  %3d of %d\n",
+           sup.lines, sup.writeCalls, sup.lines ? (double)sup.writeCalls / sup.lines : 0.0,
+           sup.setupCalls, sup.cpuNs / 1000, sup.usingUring, numShards);
+    printf("SALES:   factories    %10ld %7ld %12.3f %12ld %16ld  %3d of %d\n",
+           fac.lines, fac.writeCalls, fac.lines ? (double)fac.writeCalls / fac.lines : 0.0,
+           fac.setupCalls, fac.cpuNs / 1000, fac.usingUring, numProcs);
+}
+
 //This is our main function that runs the rest of the code needed for sales. 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <numfactories> <ordersize>\n", argv[0]);
+    //Optional -s splits the supervisor into that many shards, each owning a subset of factories.
+    //Optional -w hosts all the factories in that many worker processes instead of one process each
+    int opt;
+    while ((opt = getopt(argc, argv, "s:w:")) != -1) {
+        switch (opt) {
+            case 's':
+                numShards = atoi(optarg);
+                break;
+            case 'w':
+                numWorkers = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s shards] [-w workers] <numfactories> <ordersize>\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: %s [-s shards] [-w workers] <numfactories> <ordersize>\n", argv[0]);
         exit(1);
     }
-    //This is the intializer for number of factories and order size using argv[1] and argv[2]
-    int numfactories = atoi(argv[1]);
-    int ordersize = atoi(argv[2]);
+    //This is the intializer for number of factories and order size using the remaining arguments
+    int numfactories = atoi(argv[optind]);
+    int ordersize = atoi(argv[optind + 1]);
+    for (int i = 0; i < MAXSHARDS; i++) {
+        msgids[i] = -1;
+        sem_credits[i] = NULL;
+    }
 
     sigactionWrapper(SIGTERM, goodbye);
     sigactionWrapper(SIGINT, goodbye);
@@ -95,6 +195,16 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Number of factories must be between 1 and %d\n", MAXFACTORIES);
         exit(1);
     }
+    if (numShards > MAXSHARDS || numShards < 1 || numShards > numfactories) {
+        fprintf(stderr, "Number of shards must be between 1 and %d, and at most the number of factories\n",
+                MAXSHARDS);
+        exit(1);
+    }
+    if (numWorkers > MAXWORKERS || numWorkers < 0 || numWorkers > numfactories) {
+        fprintf(stderr, "Number of workers must be between 0 and %d, and at most the number of factories\n",
+                MAXWORKERS);
+        exit(1);
+    }
 
     //This is where we get shared memory and message queue for the sales and factory.
     int shmflg = IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR;
@@ -103,49 +213,68 @@ int main(int argc, char *argv[]) {
 
     key_t shmkey = ftok("sales.c", 1);
     shmid = Shmget(shmkey, SHMEM_SIZE, shmflg);
-    key_t msgkey = ftok("factory.c", 1);
-    msgid = Msgget(msgkey, shmflg);
+    //every supervisor shard gets its own message queue
+    for (int i = 0; i < numShards; i++) {
+        key_t msgkey = ftok("factory.c", i + 1);
+        msgids[i] = Msgget(msgkey, shmflg);
+    }
     
     sharedData = (shData *)Shmat(shmid, NULL, 0);
+    memset(sharedData, 0, SHMEM_SIZE);
     srandom(time(NULL));
 
-    sharedData->order_size = ordersize;
+    __atomic_store_n(&sharedData->order_size, ordersize, __ATOMIC_RELEASE);
     sharedData->made = 0;
     sharedData->remain = ordersize;
     sharedData->activeFactories = numfactories;
+    sharedData->numShards = numShards;
+    sharedData->numWorkers = numWorkers;
+    clock_gettime(CLOCK_MONOTONIC, &sharedData->startTime);
     sem_rendezvous = Sem_open("/cantretw_rendezvous_sem", semflg, semmode, 0);
     sem_factory_log = Sem_open("/cantretw_sem_factory_log", semflg, semmode, 1);
     printReportSem = Sem_open("/cantretw_print_report_sem", semflg, semmode, 0);
+    shardsDoneSem = Sem_open("/cantretw_shards_done_sem", semflg, semmode, 0);
+    for (int i = 0; i < numShards; i++) {
+        char creditsName[50];
+        snprintf(creditsName, sizeof(creditsName), CREDITS_SEM_NAME, i);
+        sem_credits[i] = Sem_open(creditsName, semflg, semmode, REPORT_CREDITS);
+    }
 
     printf("SALES: Will Request an Order of Size = %d parts\n", ordersize);
     printf("Creating %d Factory(ies)\n", numfactories);
+    if (numShards > 1)
+        printf("Creating %d Supervisor shards\n", numShards);
 
 
     //This is where you open supervisor.log
-    int fc = open("supervisor.log", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    //Opened for append, so each batched log write lands whole at the end of the file
+    int fc = open("supervisor.log", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR);
     if (fc == -1) {
         perror("error opening supervisor.log");
         cleanup();
         exit(1);
     }
 
-    // This is the fork for supervisor where you need to do the checks for errors
+    // This is the fork for each supervisor shard where you need to do the checks for errors
     // and you must duplicate the file.
-    pid_t supPid = Fork();
-    if (supPid == 0) {
-        dup2(fc, fileno(stdout));
-        close(fc);
-        char numfactories_str[50];
-        sprintf(numfactories_str, "%d", numfactories);
-        execlp("./supervisor", "supervisor", numfactories_str, NULL);
-        perror("execlp supervisor");
-        exit(1);
+    for (int i = 0; i < numShards; i++) {
+        pid_t supPid = Fork();
+        if (supPid == 0) {
+            dup2(fc, fileno(stdout));
+            close(fc);
+            char numfactories_str[50], shard_str[10];
+            sprintf(numfactories_str, "%d", numfactories);
+            sprintf(shard_str, "%d", i);
+            execlp("./supervisor", "supervisor", numfactories_str, shard_str, NULL);
+            perror("execlp supervisor");
+            exit(1);
+        }
+        childPids[numChildren++] = supPid;
     }
     close(fc);
-    childPids[numChildren++] = supPid;
 
     // This is the factory.log where you have to open.
-    int fd = open("factory.log", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    int fd = open("factory.log", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR);
     if (fd == -1) {
         perror("error opening factory.log");
         cleanup();
@@ -157,6 +286,13 @@ int main(int argc, char *argv[]) {
     for (int i = 0; i < numfactories; i++) {
         int capacity = (random() % 41) + 10;
         int duration = (random() % 701) + 500;
+        //register the factory's fixed parameters once, reports only carry what changes
+        sharedData->factories[i].capacity = capacity;
+        sharedData->factories[i].duration = duration;
+        printf("SALES: Factory # %3d was created, with Capacity=%4d and Duration=%4d\n",
+               i + 1, capacity, duration);
+        if (numWorkers > 0)
+            continue;
         
         pid_t factory = Fork();
         if (factory == 0) {
@@ -171,16 +307,54 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
         childPids[numChildren++] = factory;
-        
-        printf("SALES: Factory # %3d was created, with Capacity=%4d and Duration=%4d\n",
-               i + 1, capacity, duration);
     }
 
+    // With workers, every factory is registered first, then each worker
+    // hosts the factories with (id - 1) % workers == worker
+    for (int i = 0; i < numWorkers; i++) {
+        pid_t workerPid = Fork();
+        if (workerPid == 0) {
+            dup2(fd, fileno(stdout));
+            close(fd);
+            char worker[10];
+            sprintf(worker, "%d", i);
+            execlp("./factory", "factory", "-w", worker, NULL);
+            perror("execlp factory worker");
+            exit(1);
+        }
+        childPids[numChildren++] = workerPid;
+    }
+    if (numWorkers > 0)
+        printf("SALES: %d Worker process(es) are hosting the Factories\n", numWorkers);
+
     //Lastly this is where you wait and post depending on when the code is supposed to run from factory
     // or supervisor. And lastly call cleanup to close and unlink the semaphores necessary.
     close(fd);
     Sem_wait(sem_rendezvous);
     printf("SALES: Supervisor says all Factories have completed their mission\n");
+    int coalescedReports = 0, maxQueueDepth = 0;
+    for (int i = 0; i < numShards; i++) {
+        coalescedReports += sharedData->coalescedReports[i];
+        if (sharedData->maxQueueDepth[i] > maxQueueDepth)
+            maxQueueDepth = sharedData->maxQueueDepth[i];
+    }
+    int maxReportAge = 0;
+    for (int i = 0; i < numShards; i++) {
+        if (sharedData->maxReportAge[i] > maxReportAge)
+            maxReportAge = sharedData->maxReportAge[i];
+    }
+    printf("SALES: Flow control saw %d credit stalls, %d coalesced reports, max queue depth %d\n",
+           sharedData->creditStalls, coalescedReports, maxQueueDepth);
+    printf("SALES: Oldest report waited %d milliSecs in the queue\n", maxReportAge);
+    long busyUs = 0, waitUs = 0;
+    for (int i = 0; i < numfactories; i++) {
+        facStats snap;
+        statsSnapshot(&sharedData->stats[i], &snap);
+        busyUs += snap.busyUs;
+        waitUs += snap.waitUs;
+    }
+    printf("SALES: Factories spent %ld milliSecs making parts and %ld milliSecs waiting\n",
+           busyUs / 1000, waitUs / 1000);
     sleep(2);
     printf("SALES: Permission granted to print the final report\n");
     Sem_post(printReportSem);
@@ -189,6 +363,8 @@ int main(int argc, char *argv[]) {
     for (int i = 0; i < numChildren; i++) {
         wait(NULL);
     }
+    printFootprints(numfactories);
+    printLogStats(numfactories);
 
     cleanup();
     return 0;
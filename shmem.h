@@ -5,6 +5,36 @@
 //---------------------------------------------------------------------
 
 #include <semaphore.h>
+#include <time.h>
+#include "footprint.h"
+#include "logwriter.h"
+#include "facstats.h"
+
+#define MAXFACTORIES    10000   // must fit the 14-bit facID of a packed report
+#define MAXSHARDS       8
+#define MAXWORKERS      64
+
+// The Supervisor shard that owns a given factory id
+#define SHARD_OF( facID , numShards )   ( ( (facID) - 1 ) % (numShards) )
+
+// Per-shard report credit semaphore, formatted with the shard index
+#define CREDITS_SEM_NAME    "/cantretw_sem_credits_%d"
+
+// A factory's fixed parameters, registered once by Sales when it is created
+typedef struct 
+{
+    int          capacity ;
+    int          duration ;
+    footprint_t  mem ;      // filled in by the factory just before it exits
+    logStats_t   log ;      // ditto
+} facInfo ;
+
+// A worker process hosting many logical factories (sales -w)
+typedef struct 
+{
+    footprint_t  mem ;      // filled in by the worker just before it exits
+    logStats_t   log ;      // ditto
+} workerInfo ;
 
 typedef struct 
 {
@@ -15,7 +45,33 @@ typedef struct
     // So, it is not always true that made + remain = order_size
 
     int   activeFactories ;
+    int   numShards ;       // #Supervisor shards, each with its own message queue
+    int   numWorkers ;      // #worker processes hosting the factories, 0 for a process per factory
+    struct timespec startTime ;   // CLOCK_MONOTONIC when the order was placed
+
+    facInfo      factories[MAXFACTORIES] ;
+    facStats     stats[MAXFACTORIES] ;        // one cache line per factory, see facstats.h
+    workerInfo   workers[MAXWORKERS] ;
+    footprint_t  supervisorMem[MAXSHARDS] ;   // filled in by each shard just before it exits
+    logStats_t   supervisorLog[MAXSHARDS] ;   // ditto
+
+    // Per-factory totals rebuilt from the reports. Only the shard that owns a factory
+    // writes its entries. The Supervisor checks them against the stats slots
+    int   factoryParts[MAXFACTORIES] ;
+    int   factoryIterations[MAXFACTORIES] ;
+
+    // Flow-control metrics. Factories bump creditStalls, each shard owns its own slots
+    int   creditStalls ;                // #times a factory finished a batch with no report credit
+    int   coalescedReports[MAXSHARDS] ; // #iterations folded into a later report instead of sent
+    int   maxQueueDepth[MAXSHARDS] ;    // deepest each shard's message queue was seen, sampled
+    int   maxReportAge[MAXSHARDS] ;     // longest a report waited in the queue, mSecs
 } shData ;
 
 #define SHMEM_SIZE      sizeof(shData)
-#define MAXFACTORIES    20
+
+// #production reports that may sit in one shard's message queue at once. The
+// Supervisor shard grants a credit back for every report it consumes
+#define REPORT_CREDITS  32
+
+// The Supervisor samples its queue depth on its first message, then once every this many
+#define DEPTH_SAMPLE_EVERY  16
@@ -9,80 +9,181 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include "wrappers.h"
 #include "message.h"
 #include "shmem.h"
 
+// Set by SIGUSR1, asks for a mid-run snapshot of every factory's stats slot
+volatile sig_atomic_t snapshotRequested = 0;
+
+void requestSnapshot(int sig) {
+    (void)sig;
+    snapshotRequested = 1;
+}
+
+// Log a snapshot of every factory's stats slot. Exact at any moment, and the
+// factories never wait for it
+void logSnapshot(shData *sharedData, int numFactories) {
+    facStats snap;
+    int totalParts = 0;
+    logPrintf("SUPERVISOR: Snapshot of %d factories\n", numFactories);
+    for (int i = 0; i < numFactories; i++) {
+        statsSnapshot(&sharedData->stats[i], &snap);
+        logPrintf("SUPERVISOR:   Factory # %d has made %4d parts in %5d iterations, busy %6ld ms, waiting %6ld ms\n",
+                  i + 1, snap.parts, snap.iterations, snap.busyUs / 1000, snap.waitUs / 1000);
+        totalParts += snap.parts;
+    }
+    logPrintf("SUPERVISOR:   %d parts made so far\n", totalParts);
+    logFlush();
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <num_factories>\n", argv[0]);
+    // Before anything else, so an early SIGUSR1 can't kill the Supervisor
+    sigactionWrapper(SIGUSR1, requestSnapshot);
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <num_factories> [<shard>]\n", argv[0]);
         exit(1);
     }
     //Recieve commandline arguments and create 
     int numFactories = atoi(argv[1]);
-    //Array to track total parts made by each factory and initialized it to zero
-    int factoryParts[MAXFACTORIES] = {0};
-    int factoryIterations[MAXFACTORIES] = {0};
+    //Shard 0 is the primary, it merges every shard's totals into the final report
+    int shard = (argc == 3) ? atoi(argv[2]) : 0;
 
     key_t shmkey = ftok("sales.c", 1);
     int shmid = Shmget(shmkey, SHMEM_SIZE, S_IRUSR | S_IWUSR);
     shData *sharedData = Shmat(shmid, NULL, 0);
+    int numShards = sharedData->numShards;
 
-    key_t msgkey = ftok("factory.c", 1);
+    key_t msgkey = ftok("factory.c", shard + 1);
     int msgid = Msgget(msgkey, S_IRUSR | S_IWUSR);
 
     sem_t *sem_rendezvous = Sem_open2("/cantretw_rendezvous_sem", 0);
     sem_t *printReportSem = Sem_open2("/cantretw_print_report_sem", 0);
-    printf("SUPERVISOR: Started\n");
-    fflush(stdout);
+    sem_t *shardsDoneSem = Sem_open2("/cantretw_shards_done_sem", 0);
+    char creditsName[50];
+    snprintf(creditsName, sizeof(creditsName), CREDITS_SEM_NAME, shard);
+    sem_t *sem_credits = Sem_open2(creditsName, 0);
+    //log lines are batched, and flushed whenever we are about to block
+    logInit(fileno(stdout));
+    if (shard == 0)
+        logPrintf("SUPERVISOR: Started\n");
 
-    //Track number of active factories
-    int activeFactories = numFactories;
+    //Track number of active factories owned by this shard
+    int activeFactories = 0;
+    for (int id = 1; id <= numFactories; id++) {
+        if (SHARD_OF(id, numShards) == shard)
+            activeFactories++;
+    }
     msgBuf msg;
+    report_t r;
+    struct msqid_ds queueStat;
+    long received = 0;
 
     while (activeFactories > 0) {
-        if (msgrcv(msgid, &msg, MSG_INFO_SIZE, 1, 0) == -1) {
-            perror("msgrcv failed");
-            exit(1);
+        if (snapshotRequested) {
+            snapshotRequested = 0;
+            logSnapshot(sharedData, numFactories);
+        }
+        //drain the queue without blocking, and only flush the log once it is empty
+        if (msgrcv(msgid, &msg, MSG_INFO_SIZE, 0, IPC_NOWAIT) == -1) {
+            if (errno != ENOMSG && errno != EINTR) {
+                perror("msgrcv failed");
+                exit(1);
+            }
+            logFlush();
+            if (msgrcv(msgid, &msg, MSG_INFO_SIZE, 0, 0) == -1) {
+                //a snapshot request interrupted us, go handle it
+                if (errno == EINTR)
+                    continue;
+                perror("msgrcv failed");
+                exit(1);
+            }
         }
-        int facIndex = msg.facID - 1;
+        unpackMsg(&msg, &r);
+        int facIndex = r.facID - 1;
+
+        //how long the report sat in the queue before we got to it
+        int age = (reportClock(&sharedData->startTime) - r.timestamp) & REPORT_TIME_MASK;
+        if (age > sharedData->maxReportAge[shard])
+            sharedData->maxReportAge[shard] = age;
+
+        //sample the queue depth, including the message we just took off, on the first
+        //message and then every DEPTH_SAMPLE_EVERY so it does not cost a syscall per message
+        if (received++ % DEPTH_SAMPLE_EVERY == 0 &&
+            msgctl(msgid, IPC_STAT, &queueStat) == 0 &&
+            (int)queueStat.msg_qnum + 1 > sharedData->maxQueueDepth[shard])
+            sharedData->maxQueueDepth[shard] = queueStat.msg_qnum + 1;
         
-        if (msg.purpose == PRODUCTION_MSG) {
-            printf("SUPERVISOR: Factory # %d produced %3d parts in %4d milliSecs\n",
-                   msg.facID, msg.partsMade, msg.duration);
-            fflush(stdout);
+        if (msg.mtype == PRODUCTION_MSG) {
+            //hand the report credit back to the factories
+            Sem_post(sem_credits);
+
+            logPrintf("SUPERVISOR: Factory # %d produced %3d parts in %4d milliSecs\n",
+                      r.facID, r.partsMade, sharedData->factories[facIndex].duration * r.iterations);
             
-            factoryParts[facIndex] += msg.partsMade;
-            factoryIterations[facIndex]++;
+            sharedData->factoryParts[facIndex] += r.partsMade;
+            sharedData->factoryIterations[facIndex] += r.iterations;
+            sharedData->coalescedReports[shard] += r.iterations - 1;
         }
-        else if (msg.purpose == COMPLETION_MSG) {
-            printf("SUPERVISOR: Factory # %d        COMPLETED its task\n", msg.facID);
-            fflush(stdout);
+        else if (msg.mtype == COMPLETION_MSG) {
+            logPrintf("SUPERVISOR: Factory # %d        COMPLETED its task\n", r.facID);
             activeFactories--;
         }
     }
-    printf("SUPERVISOR: Manufacturing is complete. Awaiting permission to print final report\n");
-    fflush(stdout);
 
-    Sem_post(sem_rendezvous);
-    Sem_wait(printReportSem);
+    logFlush();
+    if (shard == 0) {
+        //wait for every other shard to finish its factories before reporting
+        for (int i = 1; i < numShards; i++)
+            Sem_wait(shardsDoneSem);
 
-    //print final production report
-    printf("\n****** SUPERVISOR: Final Report ******\n");
-    int grandTotal = 0;
-    //print statistics for each factory
-    for (int i = 0; i < numFactories; i++) {
-        printf("Factory # %d made a total of %4d parts in %5d iterations\n",
-               i + 1, factoryParts[i], factoryIterations[i]);
-        grandTotal += factoryParts[i];
+        logPrintf("SUPERVISOR: Manufacturing is complete. Awaiting permission to print final report\n");
+        logFlush();
+
+        Sem_post(sem_rendezvous);
+        Sem_wait(printReportSem);
+
+        //take the final totals from the factories' own stats slots, and check
+        //them against what the reports added up to
+        facStats *finalStats = calloc(numFactories, sizeof(facStats));
+        if (finalStats == NULL)
+            unix_error("supervisor calloc failed");
+        for (int i = 0; i < numFactories; i++) {
+            statsSnapshot(&sharedData->stats[i], &finalStats[i]);
+            if (finalStats[i].parts != sharedData->factoryParts[i] ||
+                finalStats[i].iterations != sharedData->factoryIterations[i]) {
+                logPrintf("SUPERVISOR: WARNING Factory # %d stats slot has %d parts in %d iterations,"
+                          " but its reports add up to %d parts in %d iterations\n",
+                          i + 1, finalStats[i].parts, finalStats[i].iterations,
+                          sharedData->factoryParts[i], sharedData->factoryIterations[i]);
+            }
+        }
+
+        //print final production report
+        logPrintf("\n****** SUPERVISOR: Final Report ******\n");
+        int grandTotal = 0;
+        //print statistics for each factory
+        for (int i = 0; i < numFactories; i++) {
+            logPrintf("Factory # %d made a total of %4d parts in %5d iterations\n",
+                      i + 1, finalStats[i].parts, finalStats[i].iterations);
+            grandTotal += finalStats[i].parts;
+        }
+        free(finalStats);
+        logPrintf("===============================\n");
+        logPrintf("Grand total parts made = %d    vs    order size of %d\n\n",
+                  grandTotal, __atomic_load_n(&sharedData->order_size, __ATOMIC_ACQUIRE));
+        logPrintf(">>> Supervisor Terminated\n");
+    }
+    else {
+        Sem_post(shardsDoneSem);
     }
-    printf("===============================\n");
-    printf("Grand total parts made = %d    vs    order size of %d\n\n",
-           grandTotal, sharedData->order_size);
-    printf(">>> Supervisor Terminated\n");
-    fflush(stdout);
+    logClose(&sharedData->supervisorLog[shard]);
+    readFootprint(&sharedData->supervisorMem[shard]);
     Sem_close(sem_rendezvous);
     Sem_close(printReportSem);
+    Sem_close(shardsDoneSem);
+    Sem_close(sem_credits);
     Shmdt(sharedData);
 
     return 0;
@@ -164,9 +164,30 @@ int  Sem_wait( sem_t *sem )
 {
     int code ;
 
-    code = sem_wait(sem) ;
-    if ( code != 0 )
+    while ( ( code = sem_wait(sem) ) != 0 )
+    {
+        if ( errno == EINTR )
+            continue ;
         unix_error( "Sem_wait error" ) ;
+    }
+    return code ;
+}
+
+//------------------
+// Returns 0 if the semaphore was taken, -1 if it is currently zero
+
+int  Sem_trywait( sem_t *sem ) 
+{
+    int code ;
+
+    while ( ( code = sem_trywait(sem) ) != 0 )
+    {
+        if ( errno == EINTR )
+            continue ;
+        if ( errno == EAGAIN )
+            return -1 ;
+        unix_error( "Sem_trywait error" ) ;
+    }
     return code ;
 }
 
@@ -26,6 +26,7 @@ int     Shmdt( const void *shmaddr ) ;
 
 void    Sem_init( sem_t *sem, int pshared, unsigned int value ) ;
 int     Sem_wait( sem_t *sem );
+int     Sem_trywait( sem_t *sem );
 int     Sem_post( sem_t *sem ) ;
 int     Sem_destroy( sem_t *sem ) ;
 sem_t  *Sem_open( const char *name, int oflag, mode_t mode, unsigned int value );